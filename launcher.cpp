@@ -16,9 +16,29 @@
 #include <pwd.h> // used to get user home dir
 #include <future>
 #include <X11/extensions/Xrandr.h>
+#include <sys/mman.h> // memory-mapped desktop files
+#include <fcntl.h> // open flags for desktop files
+#include <cstring> // memcpy for index records
+#include <sys/socket.h> // daemon control socket
+#include <sys/un.h>
+#include <csignal> // reaping launched applications in daemon mode
+#include <sys/inotify.h> // watching application dirs in daemon mode
+#include <poll.h>
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <string_view>
+#include <climits>
+#include <numeric> // iota
+#include <sys/eventfd.h> // waking the search thread and the event loop
+#include <sys/timerfd.h> // cursor blink and clock
+#include <cmath> // decaying launch history
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // vectorised substring search
+#endif
 
 namespace fs = std::filesystem;
-using std::string, std::map, std::vector, std::ifstream, std::ofstream, std::stringstream, std::thread, std::promise;
+using std::string, std::map, std::set, std::vector, std::ifstream, std::ofstream, std::stringstream, std::thread, std::promise;
 
 enum StyleAttribute {
 	NAME,
@@ -32,13 +52,15 @@ struct Keyword {
 };
 
 struct Application {
-	string id, name, genericName, comment, cmd;
+	string id, desktopId, name, genericName, comment, cmd; // id is the path, desktopId is as in the XDG menu spec
 	vector<Keyword> keywords;
+	bool hidden; // NoDisplay=true or Hidden=true
+	string onlyShowIn, notShowIn, tryExec; // checked when the list is collected, as they depend on the environment
 };
 
 struct Result {
-	Application *app;
-	int score;
+	int app; // row in the application table
+	int64_t score; // wide enough for a remembered query on top of the best match
 };
 
 const int BASE_DPI = 96;
@@ -48,15 +70,54 @@ const int TEXT_OFFSET = 0.63 * ROW_HEIGHT;
 const int BORDER_WIDTH = 3;
 const int INDENT = 14;
 const int COMMENT_SPACE = 8;
+const int MAX_RESULTS = 10; // rows shown
 const string HOME_DIR      = getenv("HOME")            != NULL ? getenv("HOME")            : getpwuid(getuid())->pw_dir;
 const string CONFIG_DIR    = getenv("XDG_CONFIG_HOME") != NULL ? getenv("XDG_CONFIG_HOME") : HOME_DIR + "/.config";
 const string DATA_DIR      = getenv("XDG_DATA_HOME")   != NULL ? getenv("XDG_DATA_HOME")   : HOME_DIR + "/.local/share";
+const string CACHE_DIR     = getenv("XDG_CACHE_HOME")  != NULL ? getenv("XDG_CACHE_HOME")  : HOME_DIR + "/.cache";
+const string RUNTIME_DIR   = getenv("XDG_RUNTIME_DIR") != NULL ? getenv("XDG_RUNTIME_DIR") : "/tmp";
+const string STATE_DIR     = getenv("XDG_STATE_HOME")  != NULL ? getenv("XDG_STATE_HOME")  : HOME_DIR + "/.local/state";
 const string CONFIG        = CONFIG_DIR + "/launcher.conf";
-const string APP_DIRS[]    = { "/usr/share/applications", "/usr/local/share/applications", DATA_DIR + "/applications" };
+const string SOCKET        = RUNTIME_DIR + "/proto-launcher-" + std::to_string(getuid()) + ".sock";
+const string INDEX         = CACHE_DIR + "/launcher.index";
+const uint32_t INDEX_MAGIC = 0x78696c70; // "plix"
+const uint32_t INDEX_VERSION = 4;
+const string HISTORY       = STATE_DIR + "/launcher.history";
+const uint32_t HISTORY_MAGIC = 0x68736c70; // "plsh"
+const uint32_t HISTORY_VERSION = 2; // 1 had no queries
+const float FRECENCY_HALF_LIFE = 14 * 24 * 60 * 60; // seconds for a launch to count half as much
+const int QUERY_MAX_LENGTH = 32; // longer queries are remembered by their first characters only
+const int64_t CHOSEN_SCORE = 1LL << 40; // more than any match, so the application last chosen for a query comes first
+const string DATA_DIRS     = getenv("XDG_DATA_DIRS") != NULL && *getenv("XDG_DATA_DIRS") ? getenv("XDG_DATA_DIRS") : "/usr/local/share:/usr/share";
+const string CURRENT_DESKTOP = getenv("XDG_CURRENT_DESKTOP") != NULL ? getenv("XDG_CURRENT_DESKTOP") : "";
+const string PATH          = getenv("PATH")            != NULL ? getenv("PATH")            : "/usr/local/bin:/usr/bin:/bin";
+
+vector<string> getAppDirs () { // most important first, where an entry in one hides an entry with the same id in the next
+	vector<string> dirs = { DATA_DIR + "/applications" };
+	stringstream ss(DATA_DIRS);
+	string dir;
+	while (getline(ss, dir, ':')) {
+		while (dir.length() > 1 && dir.back() == '/') { dir.pop_back(); }
+		if (!dir.empty() && find(dirs.begin(), dirs.end(), dir + "/applications") == dirs.end()) {
+			dirs.push_back(dir + "/applications");
+		}
+	}
+	return dirs;
+}
+
+const vector<string> APP_DIRS = getAppDirs();
 const StyleAttribute COLORS[] = { C_TITLE, C_COMMENT, C_BG, C_HIGHLIGHT, C_MATCH };
 const StyleAttribute FONTS[] = { F_REGULAR, F_BOLD, F_SMALLREGULAR, F_SMALLBOLD, F_LARGE };
 
-map<string, int> launches = {};
+struct Usage {
+	float weight; // launches, each decayed by how long ago it was
+	int64_t lastUsed; // seconds since the epoch, when weight was last decayed
+};
+
+map<string, Usage> history = {}; // by path; only read when the application table is built, and written on launch
+std::mutex historyMutex; // held to change history or queries, as tables are built on other threads
+map<string, string> queries = {}; // the path of the application launched after typing each query, kept with the history
+map<string, int> launches = {}; // launch counts from older configs, moved into the history if there isn't one yet
 
 map<StyleAttribute, const string> STYLE_ATTRIBUTES = {
 	{ C_TITLE, "title" },
@@ -181,7 +242,8 @@ int screen;
 Window window, root;
 GC gc;
 XIC xic;
-XftDraw *xftdraw;
+XftDraw *xftdraw; // draws into frame
+Pixmap frame = None; // drawn off screen, then copied to the window
 string query = "";
 string queryi = ""; // lower case
 int selected = 0;
@@ -190,11 +252,16 @@ bool cursorVisible = false;
 int width;
 float baseWidth = 0.3f; // width as percentage of screen width
 int theme = 0;
+bool fuzzy = false; // match the query's characters in order anywhere, rather than as a substring
 float scaleFactor = 1.0f;
 int inputHeight, rowHeight, textOffset, borderWidth, indent, commentSpace;
 XSetWindowAttributes attributes;
-vector<Application> applications;
-vector<Result> results;
+bool daemonMode = false; // stay resident and unmap instead of exiting
+bool mapped = false;
+int controlSocket = -1;
+vector<Result> results; // as last published by the search thread
+string resultsQuery; // what results are for, which lags behind queryi while a search runs
+bool resultsFuzzy = false;
 map<StyleAttribute, XftFont*> fonts;
 map<StyleAttribute, XftColor> colors;
 
@@ -206,7 +273,7 @@ string lowercase (const string &str) {
 
 int renderText(const int x, const int y, string text, XftFont &font, const XftColor &color) {
 	XftDrawString8(xftdraw, &color, &font, x, y, (XftChar8 *) text.c_str(), text.length());
-	if (text.back() == ' ') { // XftTextExtents appears to not count whitespace at the end of a string, so move it to the beginning
+	if (!text.empty() && text.back() == ' ') { // XftTextExtents appears to not count whitespace at the end of a string, so move it to the beginning
 		text = " " + text;
 	}
 	XGlyphInfo extents;
@@ -214,33 +281,732 @@ int renderText(const int x, const int y, string text, XftFont &font, const XftCo
 	return x + extents.width;
 }
 
-void search () {
-	results = {};
-	for (Application &app : applications) {
-		int score = 0;
-		int i = 0;
-		for (const Keyword &keyword : app.keywords) {
-			int matchIndex = keyword.word.find(queryi);
-			if (matchIndex != string::npos) {
-				// score determined by:
-				// - apps whose names begin with the query string appear first
-				// - apps whose names or descriptions contain the query string then appear
-				// - apps which hav e been opened most frequently should be prioritised
-				score = (100 - i) * keyword.weight * (matchIndex == 0 ? 10000 : 100) + launches[app.id];
-				break;
+// The applications being searched are stored column by column rather than as a struct each. The columns read for
+// every application on every keystroke (character masks and keywords) are packed together, apart from those only
+// read for the rows shown or the application launched. Strings live back to back in two arenas, one for keywords
+// and one for the rest, which are sized up front, only appended to and freed as a whole when the table is
+// replaced, rather than being dozens of small allocations per application.
+struct Text { // a string in the table's text arena
+	uint32_t offset, length;
+};
+
+struct KeywordSlot {
+	int offset, app, weight, position; // offset into the keyword arena, and the keyword's place in its application
+};
+
+struct AppTable {
+	// hot
+	vector<uint64_t> charMask; // which characters are in the keywords (see charBit)
+	vector<float> frecency; // decayed launches, resolved from the history up front so scoring never looks it up
+	vector<int> firstKeyword; // the first slot of each application, with a sentinel
+	vector<KeywordSlot> keywordSlots; // with a sentinel marking the end of the arena
+	string keywords; // every keyword in lower case, NUL separated, in application then keyword order
+	// cold
+	vector<Text> id, desktopId, name, comment, cmd;
+	vector<Usage> usage;
+	string text;
+
+	int size () const { return charMask.size(); }
+	std::string_view get (const Text &t) const { return std::string_view(text.data() + t.offset, t.length); }
+	Text add (const string &str) {
+		const Text t = { (uint32_t) text.length(), (uint32_t) str.length() };
+		text += str;
+		return t;
+	}
+	std::string_view keyword (const int slot) const { // without its NUL
+		return std::string_view(keywords.data() + keywordSlots[slot].offset, keywordSlots[slot + 1].offset - keywordSlots[slot].offset - 1);
+	}
+	std::string_view allKeywords (const int app) const { // NUL separated
+		return std::string_view(keywords.data() + keywordSlots[firstKeyword[app]].offset, keywordSlots[firstKeyword[app + 1]].offset - keywordSlots[firstKeyword[app]].offset);
+	}
+};
+
+AppTable apps;
+
+// Every keyword is listed in a dictionary sorted by word, so the keywords which start with the query are a
+// contiguous range found by binary search, without looking at any other application.
+struct Posting {
+	std::string_view word; // views the keyword arena
+	int app, position, weight; // index of the application, and of the keyword within it
+};
+
+const int NO_HIT = INT_MAX;
+vector<Posting> dictionary;
+vector<int> prefixHits; // per application, its first keyword which starts with the query (reset after each search)
+vector<int> hitApps; // the applications with a prefix hit, so that only they need resetting
+
+void indexKeywords (const AppTable &apps, vector<Posting> &dictionary) {
+	dictionary.clear();
+	for (int slot = 0; slot + 1 < apps.keywordSlots.size(); slot++) {
+		const KeywordSlot &keyword = apps.keywordSlots[slot];
+		dictionary.push_back({ apps.keyword(slot), keyword.app, keyword.position, keyword.weight });
+	}
+	sort(dictionary.begin(), dictionary.end(), [](const Posting &a, const Posting &b) {
+		return a.word < b.word;
+	});
+}
+
+// The one, two and three character substrings (grams) of every keyword are indexed too, each listing the
+// applications which contain it. An application can only contain the query if it contains every trigram of it
+// (or for short queries, the query itself as a gram), so only the applications in all of those lists are searched.
+struct Gram {
+	uint32_t key;
+	int app;
+};
+
+vector<Gram> grams; // sorted by key, then app
+typedef std::pair<vector<Gram>::const_iterator, vector<Gram>::const_iterator> GramList;
+vector<GramList> gramLists;
+vector<int> candidates, intersection; // reused between searches
+
+// A query is split into tokens at spaces, and an application matches when every token is in one of its keywords.
+string searchQuery; // lower case, the query being searched by the search thread
+bool searchFuzzy = false;
+vector<std::string_view> tokens; // views searchQuery
+
+void splitQuery (const string &query, vector<std::string_view> &tokens) {
+	tokens.clear();
+	const std::string_view str(query);
+	for (size_t start = 0, end; start < str.length(); start = end + 1) {
+		end = std::min(str.find(' ', start), str.length());
+		if (end > start) {
+			tokens.push_back(str.substr(start, end - start));
+		}
+	}
+}
+
+// Typing another character can only narrow the matches, so every application matching the previous query is kept
+// (not just the ten shown) and searched instead when the new query starts with it. Anything else, such as
+// deleting or inserting before the end, starts over from the index.
+string matchedQuery;
+vector<int> matches;
+
+uint32_t gramKey (const char *str, const int length) {
+	uint32_t key = length << 24;
+	for (int i = 0; i < length; i++) {
+		key |= (uint32_t) (unsigned char) str[i] << (8 * i);
+	}
+	return key;
+}
+
+void indexGrams (const AppTable &apps, vector<Gram> &grams) {
+	grams.clear();
+	vector<uint32_t> keys;
+	for (int a = 0; a < apps.size(); a++) {
+		keys.clear();
+		for (int slot = apps.firstKeyword[a]; slot < apps.firstKeyword[a + 1]; slot++) {
+			const std::string_view word = apps.keyword(slot);
+			for (int i = 0; i < word.length(); i++) {
+				for (int length = 1; length <= 3 && i + length <= word.length(); length++) {
+					keys.push_back(gramKey(word.data() + i, length));
+				}
 			}
-			i++;
 		}
-		if (score > 0) {
-			results.push_back({ &app, score });
+		sort(keys.begin(), keys.end());
+		keys.erase(unique(keys.begin(), keys.end()), keys.end());
+		for (const uint32_t key : keys) {
+			grams.push_back({ key, a });
+		}
+	}
+	stable_sort(grams.begin(), grams.end(), [](const Gram &a, const Gram &b) { // stable keeps apps in order
+		return a.key < b.key;
+	});
+}
+
+GramList gramApps (const uint32_t key) {
+	return equal_range(grams.cbegin(), grams.cend(), Gram { key, 0 }, [](const Gram &a, const Gram &b) {
+		return a.key < b.key;
+	});
+}
+
+void findCandidates () { // fills candidates with the (sorted) applications which may contain every token
+	candidates.clear();
+	gramLists.clear();
+	for (const std::string_view token : tokens) {
+		const int gramLength = std::min((int) token.length(), 3);
+		for (int i = 0; i + gramLength <= token.length(); i++) {
+			gramLists.push_back(gramApps(gramKey(token.data() + i, gramLength)));
 		}
 	}
-	sort(results.begin(), results.end(), [](const Result &a, const Result &b) {
-		return b.score < a.score;
+	sort(gramLists.begin(), gramLists.end(), [](const auto &a, const auto &b) { // intersect the shortest lists first
+		return a.second - a.first < b.second - b.first;
 	});
-	if (results.size() > 10) {
-		results.resize(10); // limit to 10 results
+	for (auto gram = gramLists[0].first; gram != gramLists[0].second; gram++) {
+		candidates.push_back(gram->app);
+	}
+	for (int i = 1; i < gramLists.size() && !candidates.empty(); i++) {
+		intersection.clear();
+		auto gram = gramLists[i].first;
+		for (const int app : candidates) {
+			while (gram != gramLists[i].second && gram->app < app) { gram++; }
+			if (gram == gramLists[i].second) { break; }
+			if (gram->app == app) {
+				intersection.push_back(app);
+			}
+		}
+		candidates.swap(intersection);
+	}
+}
+
+// The keywords of all applications are also packed, in order, into one NUL-separated arena with a slot per
+// keyword, so matching reads one contiguous run of memory per application instead of chasing a string per keyword.
+// The run is searched 16 or 32 positions at a time by comparing the query's first and last characters with
+// vector instructions, and only positions where both match are compared in full (a rare event in practice).
+const int ARENA_PADDING = 32; // vector loads may read this far past the end of the last keyword
+
+size_t findScalar (const char *text, const size_t length, const char *needle, const size_t needleLength) {
+	const size_t i = std::string_view(text, length).find(std::string_view(needle, needleLength));
+	return i == std::string_view::npos ? length : i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Both kernels return the first position in text (which must be readable for ARENA_PADDING bytes past length)
+// where needle starts, or length if there is none.
+__attribute__((target("sse2")))
+size_t findSse2 (const char *text, const size_t length, const char *needle, const size_t needleLength) {
+	if (needleLength > length) { return length; }
+	const size_t positions = length - needleLength + 1;
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+	for (size_t i = 0; i < positions; i += 16) {
+		const __m128i blockFirst = _mm_loadu_si128((const __m128i *) (text + i));
+		const __m128i blockLast = _mm_loadu_si128((const __m128i *) (text + i + needleLength - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+		if (positions - i < 16) {
+			mask &= (1u << (positions - i)) - 1; // positions past the end
+		}
+		for (; mask != 0; mask &= mask - 1) {
+			const size_t j = i + __builtin_ctz(mask);
+			if (needleLength <= 2 || memcmp(text + j + 1, needle + 1, needleLength - 2) == 0) { return j; }
+		}
+	}
+	return length;
+}
+
+__attribute__((target("avx2")))
+size_t findAvx2 (const char *text, const size_t length, const char *needle, const size_t needleLength) {
+	if (needleLength > length) { return length; }
+	const size_t positions = length - needleLength + 1;
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+	for (size_t i = 0; i < positions; i += 32) {
+		const __m256i blockFirst = _mm256_loadu_si256((const __m256i *) (text + i));
+		const __m256i blockLast = _mm256_loadu_si256((const __m256i *) (text + i + needleLength - 1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast)));
+		if (positions - i < 32) {
+			mask &= (1u << (positions - i)) - 1;
+		}
+		for (; mask != 0; mask &= mask - 1) {
+			const size_t j = i + __builtin_ctz(mask);
+			if (needleLength <= 2 || memcmp(text + j + 1, needle + 1, needleLength - 2) == 0) { return j; }
+		}
+	}
+	return length;
+}
+
+size_t (*const findSubstring) (const char *, size_t, const char *, size_t) = __builtin_cpu_supports("avx2") ? findAvx2
+	: __builtin_cpu_supports("sse2") ? findSse2
+	: findScalar;
+#else
+size_t (*const findSubstring) (const char *, size_t, const char *, size_t) = findScalar;
+#endif
+
+// Each application also has a bitmask of the characters in its keywords, so one that lacks any character of the
+// query is rejected with a single AND before any string is compared. That makes scanning every application cheap
+// enough that the dictionary and trigram index are only built for lists too large to scan on every keystroke.
+const int INDEX_MIN_APPS = 2000;
+bool indexed = false;
+
+uint64_t charBit (const unsigned char c) { // letters and digits get a bit each, everything else shares the rest
+	if (c >= 'a' && c <= 'z') { return 1ULL << (c - 'a'); }
+	if (c >= '0' && c <= '9') { return 1ULL << (26 + c - '0'); }
+	return 1ULL << (36 + c % 28);
+}
+
+uint64_t charMask (const std::string_view str) {
+	uint64_t mask = 0;
+	for (const char c : str) {
+		mask |= charBit(c == '\0' ? ' ' : c); // keyword separators match spaces in fuzzy queries
+	}
+	return mask;
+}
+
+AppTable buildAppTable (const vector<Application> &applications) {
+	AppTable table;
+	size_t textLength = 0, keywordsLength = ARENA_PADDING, keywordCount = 1;
+	for (const Application &app : applications) {
+		textLength += app.id.length() + app.desktopId.length() + app.name.length() + app.comment.length() + app.cmd.length();
+		for (const Keyword &keyword : app.keywords) {
+			keywordsLength += keyword.word.length() + 1;
+		}
+		keywordCount += app.keywords.size();
+	}
+	table.text.reserve(textLength);
+	table.keywords.reserve(keywordsLength);
+	table.keywordSlots.reserve(keywordCount);
+	for (int a = 0; a < applications.size(); a++) {
+		const Application &app = applications[a];
+		table.id.push_back(table.add(app.id));
+		table.desktopId.push_back(table.add(app.desktopId));
+		table.name.push_back(table.add(app.name));
+		table.comment.push_back(table.add(app.comment));
+		table.cmd.push_back(table.add(app.cmd));
+		table.firstKeyword.push_back(table.keywordSlots.size());
+		for (int i = 0; i < app.keywords.size(); i++) {
+			table.keywordSlots.push_back({ (int) table.keywords.length(), a, app.keywords[i].weight, i });
+			table.keywords += app.keywords[i].word;
+			table.keywords += '\0';
+		}
+	}
+	table.firstKeyword.push_back(table.keywordSlots.size());
+	table.keywordSlots.push_back({ (int) table.keywords.length(), (int) applications.size(), 0, 0 });
+	table.keywords.append(ARENA_PADDING, '\0');
+	std::lock_guard<std::mutex> lock(historyMutex);
+	for (int a = 0; a < applications.size(); a++) {
+		table.charMask.push_back(charMask(table.allKeywords(a)));
+		const auto used = history.find(applications[a].id);
+		table.usage.push_back(used != history.end() ? used->second : Usage { 0, 0 });
+	}
+	table.frecency.resize(applications.size());
+	return table;
+}
+
+int64_t now () {
+	return time(NULL);
+}
+
+float decayed (const Usage &usage, const int64_t time) {
+	return usage.weight * exp2f(-(time - usage.lastUsed) / FRECENCY_HALF_LIFE);
+}
+
+void updateFrecency (AppTable &table) { // once per session rather than per search, as it only changes over days
+	const int64_t time = now();
+	for (int a = 0; a < table.size(); a++) {
+		table.frecency[a] = decayed(table.usage[a], time);
+	}
+}
+
+// Queries typed before launching an application are remembered, and typing one again puts that application
+// first. Every prefix of the query is remembered, as it was typed on the way, and they are kept in a trie so the
+// application for the current query is found a character at a time however many queries there are.
+struct QueryNode {
+	char c;
+	int child, sibling; // first child and next sibling, or -1
+	int app; // row chosen for the query ending here, or -1
+};
+
+vector<QueryNode> queryTrie = { { 0, -1, -1, -1 } }; // the root is the empty query
+
+int queryChild (const vector<QueryNode> &trie, const int node, const char c) {
+	for (int n = trie[node].child; n != -1; n = trie[n].sibling) {
+		if (trie[n].c == c) { return n; }
+	}
+	return -1;
+}
+
+void addQuery (vector<QueryNode> &trie, const std::string_view query, const int app) {
+	int node = 0;
+	for (const char c : query) {
+		int next = queryChild(trie, node, c);
+		if (next == -1) {
+			next = trie.size();
+			trie.push_back({ c, -1, trie[node].child, -1 });
+			trie[node].child = next;
+		}
+		node = next;
+	}
+	trie[node].app = app;
+}
+
+int chosenApp (const vector<std::string_view> &tokens) { // looked up as the tokens joined by single spaces
+	int node = 0, depth = 0;
+	for (int t = 0; t < tokens.size() && depth < QUERY_MAX_LENGTH; t++) {
+		if (t > 0) {
+			if (depth + 1 == QUERY_MAX_LENGTH) { break; } // prefixes ending in a space aren't remembered
+			node = queryChild(queryTrie, node, ' ');
+			depth++;
+		}
+		for (int i = 0; i < tokens[t].length() && node != -1 && depth < QUERY_MAX_LENGTH; i++, depth++) {
+			node = queryChild(queryTrie, node, tokens[t][i]);
+		}
+		if (node == -1) { return -1; }
+	}
+	return queryTrie[node].app;
+}
+
+void indexQueries (const AppTable &apps, vector<QueryNode> &trie) { // the trie holds rows, so it's rebuilt with the table
+	map<std::string_view, int> rows;
+	for (int a = 0; a < apps.size(); a++) {
+		rows[apps.get(apps.id[a])] = a;
+	}
+	trie.assign(1, { 0, -1, -1, -1 });
+	std::lock_guard<std::mutex> lock(historyMutex);
+	for (const auto &[query, path] : queries) {
+		const auto row = rows.find(path);
+		if (row != rows.end()) {
+			addQuery(trie, query, row->second);
+		}
+	}
+}
+
+string normalQuery (const string &query) { // without leading, trailing or repeated spaces, so "ed " and " ed" are "ed"
+	vector<std::string_view> words;
+	splitQuery(query, words);
+	string normal;
+	for (const std::string_view word : words) {
+		if (!normal.empty()) { normal += ' '; }
+		normal += word;
+	}
+	return normal;
+}
+
+void rememberQuery (const string &typed, const int app) { // with historyMutex held
+	const string path = string(apps.get(apps.id[app]));
+	const string query = normalQuery(typed);
+	for (int length = 1; length <= std::min<int>(query.length(), QUERY_MAX_LENGTH); length++) {
+		if (query[length - 1] == ' ') { continue; } // looked up without the trailing space
+		queries[query.substr(0, length)] = path;
+		addQuery(queryTrie, std::string_view(query).substr(0, length), app);
+	}
+}
+
+// Building the table and its indexes takes a while for a long list, so it is done by the thread which read the
+// list, and the event loop only swaps the finished table in. The dictionary views the keyword arena, which is
+// never short enough to be stored inside the string, so it stays put when the table is moved.
+struct PreparedTable {
+	AppTable apps;
+	vector<Posting> dictionary;
+	vector<Gram> grams;
+	vector<QueryNode> queryTrie;
+	bool indexed = false;
+};
+
+PreparedTable prepareApplications (vector<Application> applications, const bool partial = false) { // by value, so the records are freed once the table is built
+	PreparedTable table;
+	table.apps = buildAppTable(applications);
+	updateFrecency(table.apps);
+	indexQueries(table.apps, table.queryTrie);
+	table.indexed = !partial && table.apps.size() >= INDEX_MIN_APPS; // a partial table is soon replaced, so isn't worth indexing
+	if (table.indexed) {
+		indexKeywords(table.apps, table.dictionary);
+		indexGrams(table.apps, table.grams);
+	}
+	return table;
+}
+
+void setApplications (PreparedTable table) { // with tableMutex held
+	apps = std::move(table.apps);
+	dictionary = std::move(table.dictionary);
+	grams = std::move(table.grams);
+	queryTrie = std::move(table.queryTrie);
+	indexed = table.indexed;
+	matchedQuery.clear(); // matches refer to the old table
+	prefixHits.assign(apps.size(), NO_HIT);
+}
+
+int keywordScore (const int position, const int weight, const bool prefix) {
+	// score determined by:
+	// - apps whose names begin with the query string appear first
+	// - apps whose names or descriptions contain the query string then appear
+	// - apps which hav e been opened most frequently should be prioritised
+	return (100 - position) * weight * (prefix ? 10000 : 100);
+}
+
+bool isBetter (const Result &a, const Result &b) { // ties are broken by name so the order doesn't change between searches
+	if (a.score != b.score) { return a.score > b.score; }
+	const std::string_view nameA = apps.get(apps.name[a.app]), nameB = apps.get(apps.name[b.app]);
+	if (nameA != nameB) { return nameA < nameB; }
+	return apps.get(apps.id[a.app]) < apps.get(apps.id[b.app]);
+}
+
+// found is kept as a heap of the best MAX_RESULTS so far, with the worst at the front, so each match costs at
+// most O(log MAX_RESULTS) and nothing else is stored or sorted
+vector<Result> found;
+
+void addResult (const Result &result) {
+	if (found.size() < MAX_RESULTS) {
+		found.push_back(result);
+		push_heap(found.begin(), found.end(), isBetter);
+	} else if (isBetter(result, found.front())) {
+		pop_heap(found.begin(), found.end(), isBetter);
+		found.back() = result;
+		push_heap(found.begin(), found.end(), isBetter);
+	}
+}
+
+// Fuzzy matching (F3) finds the query's characters in order anywhere in the text, scored like fzf: each matched
+// character earns points, more at the start of a word or camelCase hump and when it directly follows the previous
+// match, and gaps between matches cost points. The best alignment is found by dynamic programming over the part
+// of the text between the first possible first character and the last possible last character, after a cheap
+// check that the query is a subsequence of the text at all rejects most applications.
+const int FUZZY_MATCH = 16, FUZZY_GAP_START = -3, FUZZY_GAP_EXTENSION = -1;
+const int FUZZY_BOUNDARY = 8, FUZZY_CAMEL = 7, FUZZY_CONSECUTIVE = 4, FUZZY_FIRST_MULTIPLIER = 2;
+const int FUZZY_MAX_QUERY = 64, FUZZY_MAX_TEXT = 1024;
+const int FUZZY_NONE = INT_MIN / 4; // no alignment, low enough to never overflow when gaps are subtracted
+thread_local vector<int> fuzzyScores, fuzzyBonus; // scratch, grown as needed and reused between matches
+
+enum CharClass { CHAR_OTHER, CHAR_LOWER, CHAR_UPPER, CHAR_DIGIT };
+
+CharClass charClass (const char c) {
+	if (c >= 'a' && c <= 'z') { return CHAR_LOWER; }
+	if (c >= 'A' && c <= 'Z') { return CHAR_UPPER; }
+	if (c >= '0' && c <= '9') { return CHAR_DIGIT; }
+	return (unsigned char) c >= 0x80 ? CHAR_LOWER : CHAR_OTHER; // treat non-ascii as part of a word
+}
+
+char fold (const char c) { // for comparing with the lower case query
+	return c == '\0' ? ' ' : ::tolower(c); // NUL separates keywords
+}
+
+// Returns the score of the best alignment of the (lower case) pattern in the text, or 0 if there is none, and if
+// positions is given, fills it with where in the text each pattern character was matched.
+int fuzzyMatch (const string &pattern, const std::string_view text, int *positions) {
+	const int m = pattern.length();
+	if (m == 0 || m > FUZZY_MAX_QUERY) { return 0; }
+	int first = -1, matched = 0;
+	for (int j = 0; j < text.length() && matched < m; j++) {
+		if (fold(text[j]) == pattern[matched]) {
+			first = matched == 0 ? j : first;
+			matched++;
+		}
+	}
+	if (matched < m) { return 0; }
+	int last = text.length() - 1;
+	while (fold(text[last]) != pattern[m - 1]) { last--; }
+	const int n = std::min(last - first + 1, FUZZY_MAX_TEXT);
+	if (fuzzyScores.size() < m * n) { fuzzyScores.resize(m * n); }
+	if (fuzzyBonus.size() < n) { fuzzyBonus.resize(n); }
+	for (int j = 0; j < n; j++) {
+		const CharClass prev = first + j > 0 ? charClass(text[first + j - 1]) : CHAR_OTHER;
+		const CharClass cur = charClass(text[first + j]);
+		fuzzyBonus[j] = prev == CHAR_OTHER && cur != CHAR_OTHER ? FUZZY_BOUNDARY
+			: (prev == CHAR_LOWER && cur == CHAR_UPPER) || (prev != CHAR_DIGIT && cur == CHAR_DIGIT) ? FUZZY_CAMEL
+			: 0;
+	}
+	// score[i * n + j] is the best score for the first i + 1 pattern characters with the last matched at j
+	int *score = fuzzyScores.data();
+	for (int i = 0; i < m; i++) {
+		const int *prev = score + (i - 1) * n;
+		int *row = score + i * n;
+		int gap = FUZZY_NONE; // the best score from the previous row before j - 1, less the cost of the gap to j
+		for (int j = 0; j < n; j++) {
+			row[j] = FUZZY_NONE;
+			if (fold(text[first + j]) == pattern[i]) {
+				if (i == 0) {
+					row[j] = FUZZY_MATCH + fuzzyBonus[j] * FUZZY_FIRST_MULTIPLIER;
+				} else {
+					const int consecutive = j > 0 ? prev[j - 1] + std::max(fuzzyBonus[j], FUZZY_CONSECUTIVE) : FUZZY_NONE;
+					row[j] = FUZZY_MATCH + std::max(consecutive, gap + fuzzyBonus[j]);
+				}
+			}
+			if (i > 0) {
+				gap = std::max(gap + FUZZY_GAP_EXTENSION, j > 0 ? prev[j - 1] + FUZZY_GAP_START : FUZZY_NONE);
+			}
+		}
+	}
+	const int *lastRow = score + (m - 1) * n;
+	const int end = std::max_element(lastRow, lastRow + n) - lastRow;
+	if (lastRow[end] <= FUZZY_NONE / 2) { return 0; } // the window was cut short
+	if (positions != NULL) { // retrace the alignment by finding which predecessor each score came from
+		for (int i = m - 1, j = end; i >= 0; i--) {
+			positions[i] = first + j;
+			if (i == 0) { break; }
+			const int *prev = score + (i - 1) * n;
+			const int s = score[i * n + j];
+			if (j > 0 && prev[j - 1] > FUZZY_NONE / 2 && prev[j - 1] + FUZZY_MATCH + std::max(fuzzyBonus[j], FUZZY_CONSECUTIVE) == s) {
+				j--;
+				continue;
+			}
+			for (int k = j - 2; k >= 0; k--) {
+				if (prev[k] > FUZZY_NONE / 2 && prev[k] + FUZZY_GAP_START + FUZZY_GAP_EXTENSION * (j - k - 2) + fuzzyBonus[j] + FUZZY_MATCH == s) {
+					j = k;
+					break;
+				}
+			}
+		}
+	}
+	return std::max(lastRow[end], 1); // a match with long gaps is still a match
+}
+
+int fuzzyScore (const int app) { // matches in the name rank above matches in the other keywords
+	int score = fuzzyMatch(searchQuery, apps.get(apps.name[app]), NULL);
+	if (score > 0) { return score * 10000; }
+	score = fuzzyMatch(searchQuery, apps.allKeywords(app), NULL);
+	return score > 0 ? score * 100 : -1;
+}
+
+int substringScore (const int app, const std::string_view token, const int hit) { // -1 if the app doesn't contain the token
+	const vector<KeywordSlot> &keywordSlots = apps.keywordSlots;
+	const int first = apps.firstKeyword[app];
+	// the app is scored by its first keyword which contains the token. If the index found the first prefix match,
+	// only the keywords before it need searching
+	const int end = hit == NO_HIT ? apps.firstKeyword[app + 1] : first + hit;
+	const char *text = apps.keywords.data() + keywordSlots[first].offset;
+	const size_t length = keywordSlots[end].offset - keywordSlots[first].offset;
+	const size_t found = findSubstring(text, length, token.data(), token.length()); // can't span keywords, as the token has no NULs
+	if (found < length) {
+		const int offset = keywordSlots[first].offset + found;
+		int slot = first;
+		while (keywordSlots[slot + 1].offset <= offset) { slot++; }
+		return keywordScore(keywordSlots[slot].position, keywordSlots[slot].weight, keywordSlots[slot].offset == offset);
+	}
+	return hit == NO_HIT ? -1 : keywordScore(hit, keywordSlots[first + hit].weight, true);
+}
+
+// Searching runs on its own thread so that typing never waits for it. The event loop posts each query into a
+// single slot, replacing any query the search thread hasn't taken yet, and bumps a generation counter which a
+// search checks as it goes, giving up as soon as it has been overtaken. Results come back through another slot.
+// The event loop only changes the table while holding tableMutex, which the search thread holds while it searches.
+struct SearchRequest {
+	uint64_t generation;
+	string query; // lower case
+	bool fuzzy;
+};
+
+struct SearchResults {
+	uint64_t generation;
+	vector<Result> results; // best first
+	string query;
+	bool fuzzy;
+};
+
+std::atomic<uint64_t> searchGeneration(0); // only bumped by the event loop
+std::atomic<SearchRequest *> searchMailbox(NULL); // the latest query not yet taken by the search thread
+std::atomic<SearchResults *> resultsMailbox(NULL); // the latest results not yet taken by the event loop
+std::mutex tableMutex;
+int searchWake = -1; // eventfd, written when a query is posted
+int loopWake = -1; // eventfd, written by other threads when they have something for the event loop
+
+void wakeLoop () {
+	const uint64_t posted = 1;
+	write(loopWake, &posted, sizeof posted);
+}
+
+int64_t tokensScore (const int app) { // the sum of each token's score, or -1 if any token isn't found
+	if (tokens.size() == 1) {
+		return substringScore(app, tokens[0], prefixHits[app]);
+	}
+	int64_t score = 0;
+	for (const std::string_view token : tokens) {
+		const int tokenScore = substringScore(app, token, NO_HIT);
+		if (tokenScore < 0) { return -1; }
+		score += tokenScore;
+	}
+	return score;
+}
+
+bool search (const uint64_t generation) { // false if abandoned for a newer query
+	found.clear(); // keeps its capacity, so searching doesn't allocate
+	hitApps.clear();
+	splitQuery(searchQuery, tokens);
+	if (tokens.empty() && !searchFuzzy) { // only spaces
+		matches.clear();
+		matchedQuery.clear();
+		return true;
+	}
+	if (indexed && !searchFuzzy && tokens.size() == 1) { // prefix hits only save time for a single token
+		const std::string_view token = tokens[0];
+		auto posting = lower_bound(dictionary.begin(), dictionary.end(), token, [](const Posting &p, const std::string_view word) {
+			return p.word < word;
+		});
+		for (; posting != dictionary.end() && posting->word.substr(0, token.length()) == token; posting++) {
+			int &hit = prefixHits[posting->app];
+			if (hit == NO_HIT) {
+				hitApps.push_back(posting->app);
+			}
+			hit = std::min(hit, posting->position);
+		}
+	}
+	if (!matchedQuery.empty() && searchQuery.length() > matchedQuery.length() && searchQuery.compare(0, matchedQuery.length(), matchedQuery) == 0) {
+		candidates.swap(matches);
+	} else if (indexed && !searchFuzzy) { // the index only knows about substrings
+		findCandidates();
+	} else {
+		candidates.resize(apps.size());
+		iota(candidates.begin(), candidates.end(), 0);
+	}
+	matches.clear();
+	const uint64_t queryMask = charMask(searchQuery);
+	const int chosen = chosenApp(tokens);
+	bool abandoned = false;
+	for (int i = 0; i < candidates.size(); i++) {
+		if (i % 64 == 0 && searchGeneration.load(std::memory_order_relaxed) != generation) {
+			abandoned = true;
+			break;
+		}
+		const int a = candidates[i];
+		if ((queryMask & ~apps.charMask[a]) != 0) { continue; } // a character of the query isn't in any keyword
+		const int64_t score = searchFuzzy ? fuzzyScore(a) : tokensScore(a);
+		if (score < 0) { continue; }
+		matches.push_back(a);
+		const int64_t total = score + (int64_t) (apps.frecency[a] + 0.5f) + (a == chosen ? CHOSEN_SCORE : 0); // rounded, never negative
+		if (total > 0) {
+			addResult({ a, total });
+		}
+	}
+	for (const int a : hitApps) {
+		prefixHits[a] = NO_HIT;
 	}
+	if (abandoned) {
+		matchedQuery.clear(); // matches is incomplete
+		return false;
+	}
+	matchedQuery = searchQuery;
+	sort_heap(found.begin(), found.end(), isBetter); // best first
+	return true;
+}
+
+void setSearchQuery (const string &query, const bool fuzzy) { // with tableMutex held
+	if (fuzzy != searchFuzzy) {
+		matchedQuery.clear(); // matches from the other mode can't be narrowed
+	}
+	searchQuery = query;
+	searchFuzzy = fuzzy;
+}
+
+void searchApplications () { // the search thread
+	while (true) {
+		uint64_t posted;
+		if (read(searchWake, &posted, sizeof posted) != sizeof posted) { continue; }
+		SearchRequest *request = searchMailbox.exchange(NULL);
+		if (request == NULL) { continue; } // already taken after an earlier wake up
+		std::lock_guard<std::mutex> lock(tableMutex);
+		setSearchQuery(request->query, request->fuzzy);
+		const uint64_t generation = request->generation;
+		delete request;
+		if (search(generation)) {
+			delete resultsMailbox.exchange(new SearchResults { generation, found, searchQuery, searchFuzzy });
+			wakeLoop();
+		}
+	}
+}
+
+void requestSearch () {
+	const uint64_t generation = ++searchGeneration;
+	delete searchMailbox.exchange(new SearchRequest { generation, queryi, fuzzy });
+	const uint64_t posted = 1;
+	write(searchWake, &posted, sizeof posted);
+}
+
+std::unique_lock<std::mutex> lockTable () { // for the event loop, which abandons any search rather than waiting for it
+	searchGeneration++;
+	return std::unique_lock<std::mutex>(tableMutex);
+}
+
+void searchNow () { // on the event loop, when the results can't wait for the search thread
+	const auto lock = lockTable();
+	setSearchQuery(queryi, fuzzy);
+	search(searchGeneration);
+	results = found;
+	resultsQuery = queryi;
+	resultsFuzzy = fuzzy;
+	if (selected >= results.size()) {
+		selected = 0;
+	}
+}
+
+void present (const int y, const int height) { // copies rows of the frame to the window
+	XCopyArea(display, frame, window, gc, 0, y, width, height, 0, y);
 }
 
 auto lastBlink = std::chrono::system_clock::now();
@@ -251,69 +1017,105 @@ void renderTextInput (const bool showCursor) {
 	time_t t = time(NULL);
 	strftime(buffer, sizeof(buffer), "%a %e %b %H:%M", localtime(&t));
 	int clockWidth = renderText(0, 0, buffer, *fonts[F_SMALLREGULAR], colors[C_COMMENT]);
-	XClearArea(display, window, 0, 0, width, inputHeight, false); // clear input area
+	XSetForeground(display, gc, colors[C_BG].pixel);
+	XFillRectangle(display, frame, gc, 0, 0, width, inputHeight); // clear input area
 	XSetForeground(display, gc, colors[C_HIGHLIGHT].pixel); // input border color
 	XSetLineAttributes(display, gc, borderWidth, LineSolid, CapButt, JoinRound); // input border style
-	XDrawRectangle(display, window, gc, 0, 0, width - 1, inputHeight); // input border
+	XDrawRectangle(display, frame, gc, 0, 0, width - 1, inputHeight); // input border
 	renderText(width - clockWidth - indent, ty * 0.92, buffer, *fonts[F_SMALLREGULAR], colors[C_TITLE]);
 	if (showCursor) {
 		int cursorX = renderText(indent * 1.3, ty, query.substr(0, cursor), *fonts[F_LARGE], colors[C_BG]); // invisible text just to figure out cursor position
 		XSetForeground(display, gc, showCursor ? colors[C_TITLE].pixel : colors[C_BG].pixel); // cursor color
-		XFillRectangle(display, window, gc, cursorX, inputHeight / 4, 3, inputHeight / 2); // cursor
+		XFillRectangle(display, frame, gc, cursorX, inputHeight / 4, 3, inputHeight / 2); // cursor
 	}
 	renderText(indent, ty, query, *fonts[F_LARGE], colors[C_TITLE]); // visible input text
 	cursorVisible = showCursor;
 }
 
-void cursorBlink () {
-	auto now = std::chrono::system_clock::now();
-	std::chrono::duration<double> delta = now - lastBlink;
-	if (delta > (std::chrono::milliseconds) 700) { // seconds
+// The event loop sleeps until something happens, so the cursor blink and the clock are driven by a timer, armed
+// after each pass for whichever is due first: the next blink, or the next minute for the clock.
+const int CURSOR_BLINK_MS = 700;
+int blinkTimer = -1; // timerfd
+
+void cursorBlink () { // when the timer fires
+	if (frame == None) { return; } // nothing drawn yet
+	const auto now = std::chrono::system_clock::now();
+	if (now - lastBlink >= std::chrono::milliseconds(CURSOR_BLINK_MS)) {
 		renderTextInput(!cursorVisible);
+	} else if (std::chrono::duration_cast<std::chrono::minutes>(now.time_since_epoch()) != std::chrono::duration_cast<std::chrono::minutes>(lastBlink.time_since_epoch())) {
+		renderTextInput(cursorVisible); // the clock changed
+	} else {
+		return;
 	}
+	present(0, inputHeight);
+}
+
+void armBlinkTimer () { // disarmed while the window is hidden, or before anything is drawn to blink
+	itimerspec spec = {};
+	if (mapped && frame != None) {
+		const auto blink = lastBlink + std::chrono::milliseconds(CURSOR_BLINK_MS);
+		const auto minute = std::chrono::time_point_cast<std::chrono::minutes>(std::chrono::system_clock::now()) + std::chrono::minutes(1);
+		const int64_t next = std::chrono::duration_cast<std::chrono::nanoseconds>(std::min<std::chrono::system_clock::time_point>(blink, minute).time_since_epoch()).count();
+		spec.it_value = { (time_t) (next / 1000000000), (long) (next % 1000000000) };
+	}
+	timerfd_settime(blinkTimer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int renderMatches (int x, const int y, const std::string_view text, const vector<bool> &matched, XftFont &font, const XftColor &color, XftFont &matchFont, const XftColor &matchColor) {
+	for (int start = 0, end; start < text.length(); start = end) { // render each run of matched or unmatched characters
+		for (end = start + 1; end < text.length() && matched[end] == matched[start]; end++) {}
+		const string run(text.substr(start, end - start));
+		x = matched[start] ? renderText(x, y, run, matchFont, matchColor) : renderText(x, y, run, font, color);
+	}
+	return x;
 }
 
 void renderResults () {
 	int resultCount = results.size();
 
-	XClearArea(display, window, 0, inputHeight, width, resultCount * rowHeight, false); // clear results area
+	XSetForeground(display, gc, colors[C_BG].pixel);
+	XFillRectangle(display, frame, gc, 0, inputHeight, width, resultCount * rowHeight); // clear results area
 	XSetForeground(display, gc, colors[C_HIGHLIGHT].pixel); // results border color
 	XSetLineAttributes(display, gc, borderWidth, LineSolid, CapButt, JoinRound); // results border style
-	XDrawRectangle(display, window, gc, 0, inputHeight - 1, width - 1, resultCount * rowHeight - 1); // results border
-	
+	XDrawRectangle(display, frame, gc, 0, inputHeight - 1, width - 1, resultCount * rowHeight - 1); // results border
+	vector<std::string_view> tokens;
+	splitQuery(resultsQuery, tokens); // highlighted as searched, as queryi may be ahead
+
 	for (int i = 0; i < resultCount; i++) {
 		const Result result = results[i];
-		const int namei = lowercase(result.app->name).find(queryi);
-		const int commenti = lowercase(result.app->comment).find(queryi);
+		const string name(apps.get(apps.name[result.app]));
+		const string comment(apps.get(apps.comment[result.app]));
+		vector<bool> nameMatch(name.length()), commentMatch(comment.length());
+		if (resultsFuzzy) {
+			int positions[FUZZY_MAX_QUERY];
+			if (fuzzyMatch(resultsQuery, name, positions) > 0) {
+				for (int j = 0; j < resultsQuery.length(); j++) {
+					nameMatch[positions[j]] = true;
+				}
+			}
+		} else {
+			const string namei = lowercase(name), commenti = lowercase(comment);
+			for (const std::string_view token : tokens) {
+				const size_t nameAt = namei.find(token);
+				const size_t commentAt = commenti.find(token);
+				for (size_t j = 0; nameAt != string::npos && j < token.length(); j++) {
+					nameMatch[nameAt + j] = true;
+				}
+				for (size_t j = 0; commentAt != string::npos && j < token.length(); j++) {
+					commentMatch[commentAt + j] = true;
+				}
+			}
+		}
 		const int y = inputHeight + i * rowHeight;
 		int x = indent;
 
 		if (i == selected) {
 			XSetForeground(display, gc, colors[C_HIGHLIGHT].pixel);
-			XFillRectangle(display, window, gc, 0, y, width, rowHeight);
+			XFillRectangle(display, frame, gc, 0, y, width, rowHeight);
 		}
 		
-		if (namei == string::npos) {
-			x = renderText(x, y + textOffset, result.app->name.c_str(), *fonts[F_REGULAR], colors[C_TITLE]);
-		} else {
-			string str = result.app->name.substr(0, namei);
-			x = renderText(x, y + textOffset, str.c_str(), *fonts[F_REGULAR], colors[C_TITLE]);
-			str = result.app->name.substr(namei, query.length());
-			x = renderText(x, y + textOffset, str.c_str(), *fonts[F_BOLD], colors[C_MATCH]);
-			str = result.app->name.substr(namei + query.length());
-			x = renderText(x, y + textOffset, str.c_str(), *fonts[F_REGULAR], colors[C_TITLE]);
-		}
-
-		if (commenti == string::npos) {
-			renderText(x + commentSpace, y + textOffset, result.app->comment.c_str(), *fonts[F_SMALLREGULAR], colors[C_COMMENT]);
-		} else {
-			string str = result.app->comment.substr(0, commenti);
-			x = renderText(x + commentSpace, y + textOffset, str.c_str(), *fonts[F_SMALLREGULAR], colors[C_COMMENT]);
-			str = result.app->comment.substr(commenti, query.length());
-			x = renderText(x, y + textOffset, str.c_str(), *fonts[F_SMALLBOLD], colors[C_COMMENT]);
-			str = result.app->comment.substr(commenti + query.length());
-			renderText(x, y + textOffset, str.c_str(), *fonts[F_SMALLREGULAR], colors[C_COMMENT]);
-		}
+		x = renderMatches(x, y + textOffset, name, nameMatch, *fonts[F_REGULAR], colors[C_TITLE], *fonts[F_BOLD], colors[C_MATCH]);
+		renderMatches(x + commentSpace, y + textOffset, comment, commentMatch, *fonts[F_SMALLREGULAR], colors[C_COMMENT], *fonts[F_SMALLBOLD], colors[C_COMMENT]);
 	}
 }
 
@@ -331,6 +1133,8 @@ void readConfig () {
 			scaleFactor = stof(val);
 		} else if (key == "width") {
 			baseWidth = stof(val);
+		} else if (key == "search") {
+			fuzzy = val == "fuzzy";
 		} else if (key == "theme") {
 			int j = 0;
 			for (auto &t : THEMES) {
@@ -348,7 +1152,7 @@ void readConfig () {
 				}
 			}
 		} else {
-			launches[key] = stoi(val);
+			launches[key] = stoi(val); // [Launches], before the history file
 		}
 	}
 }
@@ -365,64 +1169,670 @@ void writeConfig () {
 			outfile << STYLE_ATTRIBUTES[type] << "=" << STYLE_OVERRIDE[type] << "\n";
 		}
 	}
-	outfile << "\n[Launches]\n";
+	outfile << "\n[Search]\n";
+	outfile << "search=" << (fuzzy ? "fuzzy" : "substring") << "\n";
+	outfile.close();
+}
+
+struct DesktopEntry { // values from the [Desktop Entry] group, viewing the mapped file
+	std::string_view name, genericName, comment, cmd, keywords;
+	std::string_view noDisplay, hidden, onlyShowIn, notShowIn, tryExec;
+};
+
+std::string_view trim (std::string_view str) {
+	while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) { str.remove_prefix(1); }
+	while (!str.empty() && (str.back() == ' ' || str.back() == '\t' || str.back() == '\r')) { str.remove_suffix(1); }
+	return str;
+}
+
+DesktopEntry readDesktopEntry (const char *data, size_t length) {
+	DesktopEntry entry;
+	bool inMainGroup = false;
+	const char *end = data + length;
+	for (const char *line = data; line < end; ) {
+		const char *newline = (const char *) memchr(line, '\n', end - line);
+		const char *lineEnd = newline != NULL ? newline : end;
+		const std::string_view text = trim(std::string_view(line, lineEnd - line));
+		line = lineEnd + 1;
+		if (text.empty() || text.front() == '#') { continue; }
+		if (text.front() == '[') {
+			if (inMainGroup) { break; } // other groups (e.g. [Desktop Action new-window]) have their own names
+			inMainGroup = text == "[Desktop Entry]";
+			continue;
+		}
+		if (!inMainGroup) { continue; }
+		const size_t equals = text.find('=');
+		if (equals == std::string_view::npos) { continue; }
+		const std::string_view key = trim(text.substr(0, equals));
+		const std::string_view value = trim(text.substr(equals + 1));
+		std::string_view *field = key == "Name" ? &entry.name
+			: key == "GenericName" ? &entry.genericName
+			: key == "Comment" ? &entry.comment
+			: key == "Exec" ? &entry.cmd
+			: key == "Keywords" ? &entry.keywords
+			: key == "NoDisplay" ? &entry.noDisplay
+			: key == "Hidden" ? &entry.hidden
+			: key == "OnlyShowIn" ? &entry.onlyShowIn
+			: key == "NotShowIn" ? &entry.notShowIn
+			: key == "TryExec" ? &entry.tryExec
+			: NULL;
+		if (field != NULL && field->empty()) {
+			*field = value;
+		}
+	}
+	return entry;
+}
+
+void addKeywords (vector<Keyword> &keywords, std::string_view text, const char separator, const int weight) {
+	while (!text.empty()) {
+		const size_t end = std::min(text.find(separator), text.length());
+		if (end > 0) {
+			string word(text.substr(0, end));
+			transform(word.begin(), word.end(), word.begin(), ::tolower);
+			keywords.push_back({ word, weight });
+		}
+		text.remove_prefix(std::min(end + 1, text.length()));
+	}
+}
+
+Application parseDesktopFile (const string &path) {
+	Application app = {};
+	app.id = path;
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) { return app; }
+	struct stat info;
+	void *data = fstat(fd, &info) == 0 && info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (data == MAP_FAILED) { return app; }
+	const DesktopEntry entry = readDesktopEntry((const char *) data, info.st_size);
+	// values are copied out of the mapping once, here
+	app.name = entry.name;
+	app.genericName = entry.genericName;
+	app.comment = entry.comment;
+	app.cmd = entry.cmd;
+	app.hidden = entry.noDisplay == "true" || entry.hidden == "true";
+	app.onlyShowIn = entry.onlyShowIn;
+	app.notShowIn = entry.notShowIn;
+	app.tryExec = entry.tryExec;
+	addKeywords(app.keywords, entry.name, ' ', 1000);
+	addKeywords(app.keywords, entry.keywords, ';', 1);
+	addKeywords(app.keywords, entry.genericName, ' ', 1);
+	addKeywords(app.keywords, entry.comment, ' ', 1);
+	munmap(data, info.st_size);
+	return app;
+}
 
-	for (const auto &[appid, count] : launches) {
-		if (count > 0) {
-			outfile << appid << "=" << count << "\n";
+// The index caches parsed applications between runs so that a warm start does no per-file parsing. It is a plain
+// serialized cache, read whole into memory, as every record is copied into the application table anyway. Each
+// application dir is stored with its mtime (which changes when entries are added or removed) followed by its
+// entries, each with the mtime and size of the file it was parsed from (which change when it is edited).
+struct IndexEntry {
+	int64_t mtime, size;
+	Application app;
+};
+
+struct IndexedDir {
+	int64_t mtime;
+	vector<IndexEntry> entries;
+	vector<string> subdirs;
+};
+
+struct IndexReader { // bounds-checked reads from a serialized file; a truncated file reads as not ok
+	const char *pos, *end;
+	bool ok = true;
+
+	void read (void *out, size_t length) {
+		if (!ok || end - pos < (ptrdiff_t) length) {
+			ok = false;
+			memset(out, 0, length);
+			return;
+		}
+		memcpy(out, pos, length);
+		pos += length;
+	}
+	uint32_t readU32 () { uint32_t v; read(&v, sizeof v); return v; }
+	int64_t readI64 () { int64_t v; read(&v, sizeof v); return v; }
+	string readString () {
+		uint32_t length = readU32();
+		if (!ok || end - pos < (ptrdiff_t) length) {
+			ok = false;
+			return "";
 		}
+		string str(pos, length);
+		pos += length;
+		return str;
 	}
+};
+
+void writeU32 (string &out, uint32_t v) { out.append((const char *) &v, sizeof v); }
+void writeI64 (string &out, int64_t v) { out.append((const char *) &v, sizeof v); }
+void writeString (string &out, const string &str) {
+	writeU32(out, str.length());
+	out.append(str);
+}
+
+int64_t mtimeOf (const struct stat &info) {
+	return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+map<string, IndexedDir> readIndex () {
+	map<string, IndexedDir> dirs;
+	ifstream infile(INDEX, std::ios::binary);
+	if (!infile) { return dirs; }
+	const string data((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+	IndexReader in = { data.data(), data.data() + data.length() };
+	if (in.readU32() == INDEX_MAGIC && in.readU32() == INDEX_VERSION) {
+		const uint32_t dirCount = in.readU32();
+		for (uint32_t i = 0; i < dirCount && in.ok; i++) {
+			IndexedDir &dir = dirs[in.readString()];
+			dir.mtime = in.readI64();
+			const uint32_t subdirCount = in.readU32();
+			for (uint32_t j = 0; j < subdirCount && in.ok; j++) {
+				dir.subdirs.push_back(in.readString());
+			}
+			const uint32_t entryCount = in.readU32();
+			for (uint32_t j = 0; j < entryCount && in.ok; j++) {
+				IndexEntry entry = {};
+				entry.mtime = in.readI64();
+				entry.size = in.readI64();
+				entry.app.id = in.readString();
+				entry.app.name = in.readString();
+				entry.app.genericName = in.readString();
+				entry.app.comment = in.readString();
+				entry.app.cmd = in.readString();
+				entry.app.hidden = in.readU32() != 0;
+				entry.app.onlyShowIn = in.readString();
+				entry.app.notShowIn = in.readString();
+				entry.app.tryExec = in.readString();
+				const uint32_t keywordCount = in.readU32();
+				for (uint32_t k = 0; k < keywordCount && in.ok; k++) {
+					const int weight = in.readU32();
+					entry.app.keywords.push_back({ in.readString(), weight });
+				}
+				dir.entries.push_back(std::move(entry));
+			}
+		}
+	}
+	if (!in.ok) { dirs.clear(); } // corrupt or truncated, rebuild from scratch
+	return dirs;
+}
+
+void writeIndex (const map<string, IndexedDir> &dirs) {
+	string out;
+	writeU32(out, INDEX_MAGIC);
+	writeU32(out, INDEX_VERSION);
+	writeU32(out, dirs.size());
+	for (const auto &[path, dir] : dirs) {
+		writeString(out, path);
+		writeI64(out, dir.mtime);
+		writeU32(out, dir.subdirs.size());
+		for (const string &subdir : dir.subdirs) {
+			writeString(out, subdir);
+		}
+		writeU32(out, dir.entries.size());
+		for (const IndexEntry &entry : dir.entries) {
+			writeI64(out, entry.mtime);
+			writeI64(out, entry.size);
+			writeString(out, entry.app.id);
+			writeString(out, entry.app.name);
+			writeString(out, entry.app.genericName);
+			writeString(out, entry.app.comment);
+			writeString(out, entry.app.cmd);
+			writeU32(out, entry.app.hidden);
+			writeString(out, entry.app.onlyShowIn);
+			writeString(out, entry.app.notShowIn);
+			writeString(out, entry.app.tryExec);
+			writeU32(out, entry.app.keywords.size());
+			for (const Keyword &keyword : entry.app.keywords) {
+				writeU32(out, keyword.weight);
+				writeString(out, keyword.word);
+			}
+		}
+	}
+	std::error_code ec;
+	fs::create_directories(CACHE_DIR, ec);
+	const string tmp = INDEX + "." + std::to_string(getpid()); // write then rename so readers never see a partial index
+	ofstream outfile(tmp, std::ios::binary);
+	outfile.write(out.data(), out.size());
 	outfile.close();
+	if (outfile.fail() || rename(tmp.c_str(), INDEX.c_str()) != 0) {
+		unlink(tmp.c_str());
+	}
 }
 
-vector<Application> getApplications () {
-	vector<Application> applications;
-	for (const string &dir : APP_DIRS) {
+// The launch history is kept apart from the config, as it changes on every launch. Each application has a weight
+// which is decayed whenever it is launched again, so it always means launches as of lastUsed.
+void writeHistory () {
+	string out;
+	writeU32(out, HISTORY_MAGIC);
+	writeU32(out, HISTORY_VERSION);
+	writeU32(out, history.size());
+	for (const auto &[path, usage] : history) {
+		writeString(out, path);
+		uint32_t weight;
+		memcpy(&weight, &usage.weight, sizeof weight);
+		writeU32(out, weight);
+		writeI64(out, usage.lastUsed);
+	}
+	writeU32(out, queries.size());
+	for (const auto &[query, path] : queries) {
+		writeString(out, query);
+		writeString(out, path);
+	}
+	std::error_code ec;
+	fs::create_directories(STATE_DIR, ec);
+	const string tmp = HISTORY + "." + std::to_string(getpid());
+	ofstream outfile(tmp, std::ios::binary);
+	outfile.write(out.data(), out.size());
+	outfile.close();
+	if (outfile.fail() || rename(tmp.c_str(), HISTORY.c_str()) != 0) {
+		unlink(tmp.c_str());
+	}
+}
+
+void readHistory () {
+	ifstream infile(HISTORY, std::ios::binary);
+	if (!infile) { // carry over the launch counts of older versions
+		for (const auto &[path, count] : launches) {
+			history[path] = { (float) count, now() };
+		}
+		if (!history.empty()) { writeHistory(); } // the config no longer keeps them
+		return;
+	}
+	const string data((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+	IndexReader in = { data.data(), data.data() + data.length() };
+	uint32_t version = 0;
+	if (in.readU32() == HISTORY_MAGIC && (version = in.readU32()) >= 1 && version <= HISTORY_VERSION) {
+		const uint32_t count = in.readU32();
+		for (uint32_t i = 0; i < count && in.ok; i++) {
+			const string path = in.readString();
+			Usage usage;
+			const uint32_t weight = in.readU32();
+			memcpy(&usage.weight, &weight, sizeof weight);
+			usage.lastUsed = in.readI64();
+			history[path] = usage;
+		}
+		const uint32_t queryCount = version >= 2 ? in.readU32() : 0;
+		for (uint32_t i = 0; i < queryCount && in.ok; i++) {
+			const string query = in.readString();
+			queries[query] = in.readString();
+		}
+	}
+	if (!in.ok) {
+		history.clear();
+		queries.clear();
+	}
+}
+
+bool inList (const string &list, const string &item) { // for ;-separated desktop entry lists
+	size_t i = 0;
+	while ((i = list.find(item, i)) != string::npos) {
+		const size_t end = i + item.length();
+		if ((i == 0 || list[i - 1] == ';') && (end == list.length() || list[end] == ';')) { return true; }
+		i = end;
+	}
+	return false;
+}
+
+bool isExecutable (const string &program) {
+	if (program.find('/') != string::npos) {
+		return access(program.c_str(), X_OK) == 0;
+	}
+	stringstream ss(PATH);
+	string dir;
+	while (getline(ss, dir, ':')) {
+		if (!dir.empty() && access((dir + "/" + program).c_str(), X_OK) == 0) { return true; }
+	}
+	return false;
+}
+
+bool isShown (const Application &app) {
+	if (app.hidden) { return false; }
+	if (!app.onlyShowIn.empty() || !app.notShowIn.empty()) {
+		bool included = false, excluded = false;
+		stringstream ss(CURRENT_DESKTOP);
+		string desktop;
+		while (getline(ss, desktop, ':')) {
+			included = included || inList(app.onlyShowIn, desktop);
+			excluded = excluded || inList(app.notShowIn, desktop);
+		}
+		if ((!app.onlyShowIn.empty() && !included) || excluded) { return false; }
+	}
+	return app.tryExec.empty() || isExecutable(app.tryExec);
+}
+
+// While the list is first loaded, applications are also published as soon as they are read, so the first
+// keystrokes search whatever has been read so far rather than waiting for all of it. They are appended to blocks
+// which never move once allocated (each twice the size of the last), so the event loop can read the first count
+// of them while more are added, and count only advances once every entry before it is complete. Until the whole
+// list is ready, an entry hidden by one in a more important dir may show.
+const int STREAM_FIRST_BLOCK = 64;
+const int STREAM_BLOCKS = 24;
+const int STREAM_REFRESH_MS = 50; // how often a table is built from what has been streamed
+
+struct ApplicationStream {
+	std::atomic<Application *> blocks[STREAM_BLOCKS] = {};
+	std::atomic<size_t> reserved = 0, count = 0;
+
+	static int blockOf (const size_t i) { return 63 - __builtin_clzll(i / STREAM_FIRST_BLOCK + 1); }
+	static size_t blockStart (const int block) { return STREAM_FIRST_BLOCK * ((1ULL << block) - 1); }
+
+	Application &slot (const size_t i) {
+		const int b = blockOf(i);
+		Application *block = blocks[b].load();
+		if (block == NULL) { // allocated by whichever writer gets there first
+			Application *allocated = new Application[STREAM_FIRST_BLOCK << b];
+			if (blocks[b].compare_exchange_strong(block, allocated)) {
+				block = allocated;
+			} else {
+				delete[] allocated;
+			}
+		}
+		return block[i - blockStart(b)];
+	}
+
+	const Application &operator[] (const size_t i) const { // only below count
+		const int b = blockOf(i);
+		return blocks[b].load(std::memory_order_relaxed)[i - blockStart(b)];
+	}
+
+	void append (Application app) {
+		const size_t i = reserved.fetch_add(1);
+		slot(i) = std::move(app);
+		while (count.load(std::memory_order_acquire) != i) { // wait for writers which reserved earlier
+			std::this_thread::yield();
+		}
+		count.store(i + 1, std::memory_order_release);
+	}
+
+	void clear () { // once nothing reads or writes it any more
+		for (auto &block : blocks) {
+			delete[] block.exchange(NULL);
+		}
+		reserved = count = 0;
+	}
+};
+
+ApplicationStream stream;
+
+void publish (ApplicationStream *stream, const Application &app) { // only if it may be in the list, named as it will be
+	if (stream == NULL || app.id.empty() || !isShown(app)) { return; }
+	for (const string &appDir : APP_DIRS) {
+		if (app.id.compare(0, appDir.length() + 1, appDir + "/") == 0) {
+			Application published = app;
+			published.desktopId = app.id.substr(appDir.length() + 1);
+			replace(published.desktopId.begin(), published.desktopId.end(), '/', '-');
+			stream->append(std::move(published));
+			return;
+		}
+	}
+}
+
+// Files which need parsing are spread over a pool of worker threads. Rather than each worker owning a fixed
+// share, workers claim small batches from a shared counter so a worker stuck on a slow file doesn't hold up the
+// rest. Each worker collects its applications locally, and they are merged back in file order so the list (and so
+// the order of equally scored search results) is the same however the work was split.
+const int PARSE_BATCH = 8;
+
+vector<Application> parseDesktopFiles (const vector<string> &paths, ApplicationStream *stream) {
+	vector<Application> parsed(paths.size());
+	const int workerCount = std::max(1, std::min((int) thread::hardware_concurrency(), (int) (paths.size() + PARSE_BATCH - 1) / PARSE_BATCH));
+	vector<vector<std::pair<size_t, Application>>> local(workerCount);
+	std::atomic<size_t> next(0);
+	auto work = [&](int worker) {
+		size_t start;
+		while ((start = next.fetch_add(PARSE_BATCH)) < paths.size()) {
+			const size_t end = std::min(start + PARSE_BATCH, paths.size());
+			for (size_t i = start; i < end; i++) {
+				local[worker].push_back({ i, parseDesktopFile(paths[i]) });
+				publish(stream, local[worker].back().second);
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int i = 1; i < workerCount; i++) {
+		workers.push_back(thread(work, i));
+	}
+	work(0); // the calling thread is a worker too
+	for (thread &worker : workers) {
+		worker.join();
+	}
+	for (auto &apps : local) {
+		for (auto &[i, app] : apps) {
+			parsed[i] = std::move(app);
+		}
+	}
+	return parsed;
+}
+
+map<string, IndexedDir> indexApplications (ApplicationStream *stream = NULL) {
+	map<string, IndexedDir> index = readIndex();
+	map<string, IndexedDir> updated;
+	bool changed = false;
+	vector<string> unparsed; // files which are new or have changed since they were indexed
+	vector<std::pair<IndexedDir*, size_t>> placeholders; // where each of them belongs
+	vector<string> dirs(APP_DIRS.rbegin(), APP_DIRS.rend()); // used as a stack, so subdirs are indexed before the next app dir
+	while (!dirs.empty()) {
+		const string dir = dirs.back();
+		dirs.pop_back();
 		struct stat info;
-		if (stat(dir.c_str(), &info) != 0) { continue; }
-		for (const auto &entry : fs::directory_iterator(dir)) {
-			Application app = {};
-			app.id = entry.path();
-			ifstream infile(app.id);
-			string line, keywords;
-			while (getline(infile, line)) {
-				if (app.name == "" && line.find("Name=") == 0) {
-					app.name = line.substr(5);
-				}
-				if (app.genericName == "" && line.find("GenericName=") == 0) {
-					app.genericName = line.substr(12);
-				}
-				if (app.comment == "" && line.find("Comment=") == 0) {
-					app.comment = line.substr(8);
-				}
-				if (app.cmd == "" && line.find("Exec=") == 0 && line.substr(5) != "") {
-					app.cmd = line.substr(5);
-				}
-				if (app.cmd == "" && line.find("Keywords=") == 0) {
-					keywords = line.substr(9);
+		if (updated.count(dir) > 0 || stat(dir.c_str(), &info) != 0) { continue; }
+		IndexedDir &fresh = updated[dir];
+		fresh.mtime = mtimeOf(info);
+		auto refresh = [&](const string &path, IndexEntry *cached) { // reuse the cached entry unless the file changed
+			struct stat fileInfo;
+			if (stat(path.c_str(), &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode)) {
+				changed = true;
+				return;
+			}
+			if (cached != NULL && cached->mtime == mtimeOf(fileInfo) && cached->size == fileInfo.st_size) {
+				fresh.entries.push_back(std::move(*cached));
+			} else {
+				unparsed.push_back(path);
+				placeholders.push_back({ &fresh, fresh.entries.size() });
+				fresh.entries.push_back({ mtimeOf(fileInfo), fileInfo.st_size, {} });
+				changed = true;
+			}
+		};
+		auto cached = index.find(dir);
+		if (cached != index.end() && cached->second.mtime == fresh.mtime) { // no entries added or removed
+			for (IndexEntry &entry : cached->second.entries) {
+				refresh(entry.app.id, &entry);
+			}
+			fresh.subdirs = cached->second.subdirs;
+		} else {
+			changed = true;
+			map<string, IndexEntry*> known;
+			if (cached != index.end()) {
+				for (IndexEntry &entry : cached->second.entries) {
+					known[entry.app.id] = &entry;
 				}
 			}
-			
-			stringstream ss = stringstream(lowercase(app.name));
-			string word;
-			while (getline(ss, word, ' ')) {
-				app.keywords.push_back({ word, 1000 });
+			std::error_code ec;
+			for (const auto &entry : fs::directory_iterator(dir, ec)) {
+				if (entry.is_directory(ec) && !entry.is_symlink(ec)) { // not following links avoids loops
+					fresh.subdirs.push_back(entry.path());
+					continue;
+				}
+				if (entry.path().extension() != ".desktop") { continue; } // e.g. mimeinfo.cache, defaults.list
+				const auto k = known.find(entry.path());
+				refresh(entry.path(), k == known.end() ? NULL : k->second);
 			}
+		}
+		dirs.insert(dirs.end(), fresh.subdirs.rbegin(), fresh.subdirs.rend());
+	}
+	for (const auto &[path, dir] : updated) {
+		for (const IndexEntry &entry : dir.entries) {
+			publish(stream, entry.app); // placeholders have no id yet
+		}
+	}
+	vector<Application> parsed = parseDesktopFiles(unparsed, stream);
+	for (size_t i = 0; i < parsed.size(); i++) {
+		placeholders[i].first->entries[placeholders[i].second].app = std::move(parsed[i]);
+	}
+	if (changed || index.size() != updated.size()) {
+		writeIndex(updated);
+	}
+	return updated;
+}
 
-			ss = stringstream(lowercase(keywords));
-			while (getline(ss, word, ';')) {
-				app.keywords.push_back({ word, 1 });
+// Collects the shown applications, each desktop id once. The id is the path relative to the app dir with "/"
+// replaced by "-" (so kde/konsole.desktop is kde-konsole.desktop), and the entry from the most important app dir
+// wins, even if it is hidden: that is how a user hides a system application.
+vector<Application> collectApplications (const map<string, IndexedDir> &dirs) {
+	vector<Application> applications;
+	set<string> seen;
+	for (const string &appDir : APP_DIRS) {
+		const string prefix = appDir + "/";
+		for (const auto &[path, dir] : dirs) {
+			if (path != appDir && path.compare(0, prefix.length(), prefix) != 0) { continue; }
+			for (const IndexEntry &entry : dir.entries) {
+				string desktopId = entry.app.id.substr(prefix.length());
+				replace(desktopId.begin(), desktopId.end(), '/', '-');
+				if (!seen.insert(desktopId).second || !isShown(entry.app)) { continue; }
+				applications.push_back(entry.app);
+				applications.back().desktopId = desktopId;
 			}
+		}
+	}
+	return applications;
+}
+
+vector<Application> getApplications (ApplicationStream *stream = NULL) {
+	return collectApplications(indexApplications(stream));
+}
 
-			ss = stringstream(lowercase(app.genericName + ' ' + app.comment));
-			while (getline(ss, word, ' ')) {
-				app.keywords.push_back({ word, 1 });
+// In daemon mode the application dirs are watched so the list doesn't go stale. Events are coalesced until the
+// dirs have been quiet for a moment (a package manager may touch hundreds of files), then only the files named
+// in the events are re-parsed and the new list is handed to the event loop, which swaps it in between events.
+const int WATCH_QUIET_MS = 250;
+const int WATCH_MAX_DELAY_MS = 2000;
+std::mutex updateMutex;
+PreparedTable updatedTable;
+std::atomic<bool> applicationsUpdated(false);
+
+void updateEntry (IndexedDir &dir, const string &path) {
+	auto existing = find_if(dir.entries.begin(), dir.entries.end(), [&](const IndexEntry &entry) {
+		return entry.app.id == path;
+	});
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+		if (existing != dir.entries.end()) {
+			dir.entries.erase(existing);
+		}
+		return;
+	}
+	IndexEntry entry = { mtimeOf(info), info.st_size, parseDesktopFile(path) };
+	if (existing != dir.entries.end()) {
+		*existing = std::move(entry);
+	} else {
+		dir.entries.push_back(std::move(entry));
+	}
+}
+
+void watchApplications (promise<PreparedTable> initial) {
+	const int fd = inotify_init1(IN_CLOEXEC);
+	map<int, string> watches;
+	map<int, set<string>> awaited; // parents of missing app dirs, with the names of the dirs which lead to them
+	auto watch = [&](const string &dir) { // adding a watch twice returns the same descriptor
+		const int wd = fd < 0 ? -1 : inotify_add_watch(fd, dir.c_str(), IN_ONLYDIR | IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (wd >= 0) {
+			watches[wd] = dir;
+		}
+	};
+	auto watchAppDirs = [&]() { // an app dir which doesn't exist yet (e.g. ~/.local/share/applications) is waited for in the nearest dir which does
+		for (const auto &[wd, names] : awaited) {
+			if (watches.count(wd) == 0) { inotify_rm_watch(fd, wd); }
+		}
+		awaited.clear();
+		for (const string &dir : APP_DIRS) {
+			struct stat info;
+			string path = dir;
+			if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+				watch(dir);
+				continue;
 			}
+			for (size_t slash = path.rfind('/'); fd >= 0 && slash != string::npos && slash > 0; slash = path.rfind('/')) {
+				const string name = path.substr(slash + 1);
+				path.resize(slash);
+				if (stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+					const int wd = inotify_add_watch(fd, path.c_str(), IN_ONLYDIR | IN_MASK_ADD | IN_CREATE | IN_MOVED_TO);
+					if (wd >= 0) { awaited[wd].insert(name); }
+					break;
+				}
+			}
+		}
+	};
+	watchAppDirs();
+	map<string, IndexedDir> dirs = indexApplications(&stream); // indexed after the watches are added so no change is missed
+	for (const auto &[path, dir] : dirs) {
+		watch(path); // subdirs
+	}
+	initial.set_value(prepareApplications(collectApplications(dirs)));
+	wakeLoop();
+	if (fd < 0) { return; }
 
-			applications.push_back(app);
+	alignas(inotify_event) char buffer[4096];
+	pollfd pfd = { fd, POLLIN, 0 };
+	while (1) {
+		set<string> changed; // "dir\0file" so that it can be split without searching for the dir
+		bool restructured = false; // a subdir was added or removed
+		auto burstStart = std::chrono::steady_clock::now();
+		int timeout = -1; // block until the first event of a burst
+		while (poll(&pfd, 1, timeout) > 0) {
+			const ssize_t length = read(fd, buffer, sizeof buffer);
+			for (ssize_t i = 0; i < length; ) {
+				const inotify_event *event = (const inotify_event *) (buffer + i);
+				if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) { // events were lost, or a watched dir went
+					restructured = true;
+				} else if (event->mask & IN_IGNORED) {
+					watches.erase(event->wd);
+					awaited.erase(event->wd);
+				} else if (event->len > 0 && awaited.count(event->wd) > 0 && awaited[event->wd].count(event->name) > 0) {
+					restructured = true; // a missing app dir, or a dir on the way to it, appeared
+				} else if (event->len == 0 || watches.count(event->wd) == 0) {
+					// not about a file in a watched dir
+				} else if (event->mask & IN_ISDIR) {
+					restructured = true;
+				} else if (fs::path(event->name).extension() == ".desktop") {
+					changed.insert(watches[event->wd] + '\0' + event->name);
+				}
+				i += sizeof(inotify_event) + event->len;
+			}
+			if (timeout < 0) {
+				burstStart = std::chrono::steady_clock::now();
+			}
+			const int elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - burstStart).count();
+			if (elapsed >= WATCH_MAX_DELAY_MS) { break; } // don't wait forever on a dir which never goes quiet
+			timeout = std::min(WATCH_QUIET_MS, WATCH_MAX_DELAY_MS - elapsed);
+		}
+		if (changed.empty() && !restructured) { continue; }
+		if (restructured) { // rare, so simply re-index (which only parses files which changed)
+			watchAppDirs();
+			dirs = indexApplications();
+			for (const auto &[path, dir] : dirs) {
+				watch(path);
+			}
+			changed.clear();
 		}
+		for (const string &key : changed) {
+			const size_t split = key.find('\0');
+			IndexedDir &dir = dirs[key.substr(0, split)];
+			struct stat info;
+			if (stat(key.substr(0, split).c_str(), &info) == 0) {
+				dir.mtime = mtimeOf(info);
+			}
+			updateEntry(dir, key.substr(0, split) + "/" + key.substr(split + 1));
+		}
+		if (!restructured) {
+			writeIndex(dirs);
+		}
+		PreparedTable table = prepareApplications(collectApplications(dirs));
+		std::lock_guard<std::mutex> lock(updateMutex);
+		updatedTable = std::move(table);
+		applicationsUpdated = true;
+		wakeLoop();
 	}
-	return applications;
 }
 
 void setProperty (const char *property, const char *value) {
@@ -431,11 +1841,117 @@ void setProperty (const char *property, const char *value) {
 	XChangeProperty(display, window, propertyAtom, XA_ATOM, 32, PropModeReplace, (unsigned char *) &valueAtom, 1);
 }
 
-void launch (Application &app) {
+std::future<PreparedTable> awaitApps; // the whole list, read in the background
+bool applicationsLoaded = false;
+size_t streamed = 0; // applications from the stream in the table, until the whole list is loaded
+auto streamedAt = std::chrono::steady_clock::now();
+std::future<PreparedTable> awaitPartial; // a table of what had been streamed, built in the background
+size_t partialCount = 0;
+
+void finishPartial () { // before the stream is cleared, as the build reads it
+	if (awaitPartial.valid()) {
+		awaitPartial.get();
+	}
+}
+
+bool loadApplications (const bool wait) { // true if the table changed. Unless waiting, takes what has been streamed
+	if (applicationsLoaded) { return false; }
+	if (wait || awaitApps.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		PreparedTable table = awaitApps.get();
+		finishPartial();
+		const auto lock = lockTable();
+		setApplications(std::move(table));
+		applicationsLoaded = true;
+		results = {}; // results point into the streamed list, which is in a different order
+		resultsQuery.clear();
+		stream.clear(); // the loader has finished with it
+		return true;
+	}
+	if (awaitPartial.valid()) {
+		if (awaitPartial.wait_for(std::chrono::seconds(0)) != std::future_status::ready) { return false; }
+		std::unique_lock<std::mutex> lock(tableMutex, std::try_to_lock); // rows are only appended, so a search needn't be dropped
+		if (!lock.owns_lock()) { return false; } // searching, so try again on the next pass
+		setApplications(awaitPartial.get());
+		streamed = partialCount;
+		return true;
+	}
+	const size_t count = stream.count.load(std::memory_order_acquire);
+	const auto now = std::chrono::steady_clock::now();
+	if (count == streamed || (streamed > 0 && now - streamedAt < std::chrono::milliseconds(STREAM_REFRESH_MS))) { return false; }
+	promise<PreparedTable> built;
+	awaitPartial = built.get_future();
+	partialCount = count;
+	streamedAt = now;
+	thread([count](promise<PreparedTable> built) {
+		vector<Application> applications;
+		applications.reserve(count);
+		for (size_t i = 0; i < count; i++) {
+			applications.push_back(stream[i]);
+		}
+		built.set_value(prepareApplications(std::move(applications), true));
+		wakeLoop();
+	}, std::move(built)).detach();
+	return false;
+}
+
+// Keys typed straight after the hotkey would be lost before the window is mapped and focused, so the keyboard is
+// grabbed as soon as the display is open (or the daemon is asked to show). Until the window has focus the key
+// events are sent to the root window, where they wait in the event queue and are handled in order once the event
+// loop runs. The grab is released as soon as the window has focus.
+bool keyboardGrabbed = false;
+bool awaitingFocus = false; // retry the grab until focused, as the hotkey's own grab may still be held
+const int GRAB_RETRY_MS = 10;
+
+void grabKeyboard () {
+	awaitingFocus = true;
+	keyboardGrabbed = XGrabKeyboard(display, root, True, GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess;
+}
+
+void releaseKeyboard () {
+	awaitingFocus = false;
+	if (keyboardGrabbed) {
+		XUngrabKeyboard(display, CurrentTime);
+		keyboardGrabbed = false;
+	}
+}
+
+void hide () {
+	if (!daemonMode) { exit(0); }
+	releaseKeyboard();
+	XUnmapWindow(display, window);
+	XFlush(display);
+	mapped = false;
+	query = queryi = "";
+	cursor = selected = 0;
+	results = {};
+	resultsQuery.clear();
+	searchGeneration++; // drop any search still running
+}
+
+void pruneHistory () { // forget uninstalled applications, with historyMutex held
+	map<string, bool> installed; // by path, including applications which are hidden here (e.g. OnlyShowIn another desktop)
+	auto isInstalled = [&](const string &path) {
+		auto known = installed.find(path);
+		if (known == installed.end()) {
+			struct stat info;
+			known = installed.emplace(path, stat(path.c_str(), &info) == 0).first;
+		}
+		return known->second;
+	};
+	for (auto used = history.begin(); used != history.end(); ) {
+		used = isInstalled(used->first) ? next(used) : history.erase(used);
+	}
+	for (auto query = queries.begin(); query != queries.end(); ) { // also drops prefixes remembered before they were normalised
+		query = isInstalled(query->second) && normalQuery(query->first) == query->first ? next(query) : queries.erase(query);
+	}
+}
+
+void launch (const int app) {
 	const int pid = fork(); // this duplicates the launcher process
 	if (pid == 0) { // if this is the child process, replace it with the application
+		signal(SIGCHLD, SIG_DFL); // an ignored SIGCHLD survives exec, and would break waitpid in the application
 		chdir(HOME_DIR.c_str());
-		stringstream ss(app.cmd);
+		stringstream ss = stringstream(string(apps.get(apps.cmd[app])));
 		vector<char*> args;
 		string arg;
 		while (getline(ss, arg, ' ')) {
@@ -447,17 +1963,50 @@ void launch (Application &app) {
 		args.push_back(NULL);
 		char **command = &args[0];
 		execvp(command[0], command);
+		_exit(1); // exec failed, never fall back into the launcher
 	} else {
-		launches[app.id]++;
-		writeConfig();
+		const auto lock = lockTable();
+		const int64_t time = now();
+		Usage &usage = apps.usage[app];
+		usage = { decayed(usage, time) + 1, time };
+		apps.frecency[app] = usage.weight;
+		std::lock_guard<std::mutex> historyLock(historyMutex);
+		history[string(apps.get(apps.id[app]))] = usage;
+		rememberQuery(queryi, app);
+		pruneHistory();
+		writeHistory();
 	}
-	exit(0);
+	hide();
 }
 
 Visual *visual;
 Colormap colormap;
 int windowX, windowY;
 
+// The frame is big enough for every row, so it is only replaced when the width or scale changes, rather than
+// whenever the number of results does.
+int frameWidth = 0, frameHeight = 0;
+
+void allocateFrame () {
+	const int height = inputHeight + MAX_RESULTS * rowHeight;
+	if (frame != None && width == frameWidth && height == frameHeight) { return; }
+	if (frame != None) {
+		XftDrawDestroy(xftdraw);
+		XFreePixmap(display, frame);
+	}
+	frame = XCreatePixmap(display, window, width, height, DefaultDepth(display, screen));
+	xftdraw = XftDrawCreate(display, frame, visual, colormap);
+	frameWidth = width;
+	frameHeight = height;
+}
+
+void render (const bool showCursor) { // drawn off screen and copied to the window at once, so nothing flickers
+	allocateFrame();
+	renderTextInput(showCursor);
+	renderResults();
+	present(0, inputHeight + results.size() * rowHeight);
+}
+
 map<StyleAttribute, string> getStyle () {
 	map<StyleAttribute, string> style = STYLE_DEFAULTS;
 	for (const auto &[type, val] : THEMES[theme]) {
@@ -505,7 +2054,7 @@ void updateStyle () {
 	XSetWindowBackground(display, window, colors[C_BG].pixel);
 }
 
-void updateScale () {
+void updateGeometry () { // size and position the window on the monitor which the mouse is on
 	int x, y, throwaway;
 	unsigned m;
 	Window w;
@@ -551,9 +2100,83 @@ void updateScale () {
 	}
 	windowX = monitor->x + monitor->width / 2 - width / 2;
 	windowY = monitor->y + 200;
+}
+
+void updateScale () {
+	updateGeometry();
 	updateFonts();
 }
 
+void show () {
+	if (mapped) { return; }
+	{
+		const auto lock = lockTable();
+		updateFrecency(apps); // a daemon may have been running for days
+	}
+	grabKeyboard();
+	updateGeometry(); // the mouse may be on a different monitor since the window was last shown
+	XMoveResizeWindow(display, window, windowX, windowY, width, inputHeight);
+	XMapRaised(display, window);
+	XFlush(display);
+	mapped = true;
+}
+
+sockaddr_un socketAddress () {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, SOCKET.c_str(), sizeof(address.sun_path) - 1);
+	return address;
+}
+
+int connectToDaemon () { // returns a connected socket, or -1 if no daemon is running
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) { return -1; }
+	const sockaddr_un address = socketAddress();
+	if (connect(fd, (const sockaddr *) &address, sizeof address) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool requestShow () {
+	const int fd = connectToDaemon();
+	if (fd < 0) { return false; }
+	const bool sent = write(fd, "show\n", 5) == 5;
+	close(fd);
+	return sent;
+}
+
+void listenForClients () {
+	const int running = connectToDaemon();
+	if (running >= 0) {
+		close(running);
+		std::cerr << "proto-launcher is already running as a daemon\n";
+		exit(1);
+	}
+	unlink(SOCKET.c_str()); // left behind by a daemon which did not exit cleanly
+	controlSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	const sockaddr_un address = socketAddress();
+	if (controlSocket < 0 || bind(controlSocket, (const sockaddr *) &address, sizeof address) != 0 || listen(controlSocket, 8) != 0) {
+		std::cerr << "Unable to listen on " << SOCKET << "\n";
+		exit(1);
+	}
+}
+
+void acceptClients () {
+	int fd;
+	while ((fd = accept4(controlSocket, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		const timeval timeout = { 0, 100000 }; // don't let a silent client stall the event loop
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+		char command[16] = {0};
+		const int length = read(fd, command, sizeof command - 1);
+		close(fd);
+		if (length >= 4 && strncmp(command, "show", 4) == 0) {
+			show();
+		}
+	}
+}
+
 void onKeyPress (XEvent &event) {
 	char text[128] = {0};
 	KeySym keysym;
@@ -562,10 +2185,15 @@ void onKeyPress (XEvent &event) {
 	bool ctrl = event.xkey.state == 4;
 	switch (keysym) {
 		case XK_Escape:
-			exit(0);
+			hide();
 			break;
 		case XK_Return:
-			launch(*results[selected].app);
+			if (loadApplications(true) || queryi != resultsQuery || fuzzy != resultsFuzzy) {
+				searchNow(); // typed ahead of the search thread, so launch what the query finds rather than what it found
+			}
+			if (selected < results.size()) { // the daemon outlives an empty result list
+				launch(results[selected].app);
+			}
 			break;
 		case XK_Up:
 			selected = selected > 0 ? selected - 1 : results.size() - 1;
@@ -601,6 +2229,10 @@ void onKeyPress (XEvent &event) {
 				query.erase(cursor, ctrl ? query.length() - cursor : 1);
 			}
 			break;
+		case XK_F3: // F3 to switch between substring and fuzzy matching
+			fuzzy = !fuzzy;
+			writeConfig();
+			break;
 		case XK_F4: // F4 and F5 for theme
 		case XK_F5:
 			if (keysym == XK_F4) {
@@ -636,24 +2268,57 @@ void onKeyPress (XEvent &event) {
 	queryi = lowercase(query);
 }
 
-int main () {
-	auto awaitApps = async(getApplications); // prepare list of apps in the background
+int main (int argc, char **argv) {
+	for (int i = 1; i < argc; i++) {
+		const string arg = argv[i];
+		if (arg == "--daemon") {
+			daemonMode = true;
+		} else if (arg == "--show") {
+			if (requestShow()) { return 0; } // otherwise no daemon is running, so start normally
+		} else {
+			std::cerr << "usage: proto-launcher [--daemon | --show]\n";
+			return 1;
+		}
+	}
+	if (daemonMode) {
+		listenForClients();
+		signal(SIGCHLD, SIG_IGN); // launched applications are reaped automatically
+	}
+
+	searchWake = eventfd(0, EFD_CLOEXEC);
+	loopWake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	blinkTimer = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+
 	readConfig();
+	readHistory(); // before the table is built
+	promise<PreparedTable> initial; // prepare list of apps in the background
+	awaitApps = initial.get_future();
+	if (daemonMode) {
+		thread(watchApplications, std::move(initial)).detach();
+	} else {
+		thread([](promise<PreparedTable> initial) {
+			initial.set_value(prepareApplications(getApplications(&stream)));
+			wakeLoop();
+		}, std::move(initial)).detach();
+	}
+	thread(searchApplications).detach();
 
 	display = XOpenDisplay(NULL);
 	screen = DefaultScreen(display);
 	visual = DefaultVisual(display, screen);
 	colormap = DefaultColormap(display, screen);
 	root = DefaultRootWindow(display);
+	if (!daemonMode) { // the daemon only grabs when shown
+		grabKeyboard();
+	}
 	int depth = DefaultDepth(display, screen);
-	bool applicationsLoaded = false;
 
 	updateScale();
 	
 	window = XCreateWindow(display, root,
 		windowX, windowY, width, inputHeight,
 		5, depth, InputOutput, visual, CWBackPixel, &attributes);
-	XSelectInput(display, window, ExposureMask | KeyPressMask | FocusChangeMask);
+	XSelectInput(display, window, ExposureMask | KeyPressMask | FocusChangeMask | StructureNotifyMask);
 	XIM xim = XOpenIM(display, 0, 0, 0);
 	xic = XCreateIC(xim, // input context
 		XNInputStyle,   XIMPreeditNothing | XIMStatusNothing,
@@ -662,7 +2327,8 @@ int main () {
 		NULL);
 
 	XGCValues gr_values;
-	gc = XCreateGC(display, window, 0, &gr_values);
+	gr_values.graphics_exposures = False; // copying the frame never needs exposing
+	gc = XCreateGC(display, window, GCGraphicsExposures, &gr_values);
 
 	updateStyle();
 
@@ -670,38 +2336,114 @@ int main () {
 	setProperty("_NET_WM_STATE", "_NET_WM_STATE_ABOVE");
 	setProperty("_NET_WM_STATE", "_NET_WM_STATE_MODAL");
 
-	XMapWindow(display, window);
-
-	xftdraw = XftDrawCreate(display, window, visual, colormap);
+	if (!daemonMode) { // the daemon waits to be asked to show itself
+		XMapWindow(display, window);
+		mapped = true;
+	}
 
 	XEvent event;
+	pollfd fds[] = {
+		{ ConnectionNumber(display), POLLIN, 0 },
+		{ blinkTimer, POLLIN, 0 },
+		{ loopWake, POLLIN, 0 },
+		{ controlSocket, POLLIN, 0 }, // ignored by poll unless a daemon, as it is -1
+	};
 	while (1) {
-		while (XCheckMaskEvent(display, ExposureMask | KeyPressMask | FocusChangeMask, &event)) {
+		int timeout = -1; // sleep until there is something to do
+		if (awaitingFocus && !keyboardGrabbed) {
+			timeout = GRAB_RETRY_MS;
+		} else if (!applicationsLoaded && query.length() > 0) {
+			timeout = STREAM_REFRESH_MS; // pick up more of the streamed applications
+		}
+		for (pollfd &fd : fds) {
+			fd.revents = 0;
+		}
+		if (XPending(display) == 0) { // events already read by Xlib wouldn't wake poll
+			poll(fds, sizeof fds / sizeof fds[0], timeout);
+		}
+		uint64_t expirations;
+		if (fds[1].revents & POLLIN) {
+			read(blinkTimer, &expirations, sizeof expirations);
+			if (mapped) {
+				cursorBlink();
+			}
+		}
+		if (fds[2].revents & POLLIN) {
+			read(loopWake, &expirations, sizeof expirations);
+		}
+		if (fds[3].revents & POLLIN) {
+			acceptClients();
+		}
+		// every pending event is handled before searching or drawing, so a burst of keys (autorepeat, or a paste)
+		// costs one search and one frame rather than one per key
+		const string previousQuery = query;
+		const bool previousFuzzy = fuzzy;
+		bool redraw = false, typed = false;
+		while (XPending(display) > 0) {
+			XNextEvent(display, &event);
 			if (event.type == Expose) {
-				renderTextInput(true);
-				renderResults();
+				redraw = true;
 			}
-			if (event.type == KeyPress) {
+			if (event.type == KeyPress && mapped) { // not keys queued behind the one which hid the window
+				event.xkey.window = window; // typed ahead, before the window had focus
 				onKeyPress(event);
-				if (query.length() > 0) {
-					if (!applicationsLoaded) {
-						applications = awaitApps.get();
-						applicationsLoaded = true;
-					}
-					search();
-				} else {
-					results = {};
-				}
-				if (selected >= results.size()) {
-					selected = 0;
-				}
-				XMoveResizeWindow(display, window, windowX, windowY, width, inputHeight + results.size() * rowHeight);
-				renderTextInput(true);
-				renderResults();
+				redraw = typed = true;
+			}
+			if (event.type == MapNotify && daemonMode) { // a re-mapped window is not given focus by every window manager
+				XSetInputFocus(display, window, RevertToParent, CurrentTime);
+			}
+			const bool grabbing = (event.type == FocusIn || event.type == FocusOut) && (event.xfocus.mode == NotifyGrab || event.xfocus.mode == NotifyUngrab);
+			if (event.type == FocusIn && !grabbing) { releaseKeyboard(); }
+			if (event.type == FocusOut && mapped && !grabbing) { hide(); } // not when focus only moved for a grab
+		}
+		if (query != previousQuery || fuzzy != previousFuzzy) { // not for keys which only move the cursor or selection
+			if (query.length() > 0) {
+				loadApplications(false); // whatever has been read so far
+				requestSearch();
+			} else {
+				results = {};
+				resultsQuery.clear();
+				searchGeneration++; // drop any search still running
+			}
+		}
+		if (applicationsUpdated.exchange(false)) { // the watcher re-indexed some applications
+			std::lock_guard<std::mutex> lock(updateMutex);
+			const auto tableLock = lockTable();
+			setApplications(std::move(updatedTable)); // already built, so only swapped in
+			applicationsLoaded = true; // the initial list is older than this one, so it is no longer needed
+			finishPartial();
+			stream.clear();
+			results = {}; // results point into the old list
+			resultsQuery.clear();
+			if (query.length() > 0) {
+				requestSearch();
+			}
+			redraw = true;
+		}
+		if (query.length() > 0 && loadApplications(false)) { // more applications have been read
+			requestSearch();
+		}
+		SearchResults *searched = resultsMailbox.exchange(NULL);
+		if (searched != NULL) {
+			if (searched->generation == searchGeneration) { // not overtaken by a newer query
+				results.swap(searched->results);
+				resultsQuery = searched->query;
+				resultsFuzzy = searched->fuzzy;
+				redraw = true;
 			}
-			if (event.type == FocusOut) { exit(0); }
+			delete searched;
+		}
+		if (selected >= results.size()) {
+			selected = 0;
+		}
+		if (redraw && mapped) {
+			XMoveResizeWindow(display, window, windowX, windowY, width, inputHeight + results.size() * rowHeight);
+			render(typed || cursorVisible);
+		}
+		if (awaitingFocus && !keyboardGrabbed) {
+			grabKeyboard();
 		}
-		cursorBlink();
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		armBlinkTimer();
+		XFlush(display);
 	}
 }